@@ -164,10 +164,11 @@ unsigned long getauxval(unsigned long type)
 
 /**
  * @brief Replace the old argv (1..200) for the one supplied
- * in the preloader_cli in the new-forked process.
+ * in the preloader_cli in the new-forked process and, if
+ * the client sent its environment too, the old envp.
  *
  * @param argc Amount of arguments.
- * @param cwd_argv Argument list.
+ * @param cwd_argv Argument list (+ client environment).
  * @param sp Stack pointer pointing to the first argv element.
  */
 void arch_change_argv(int argc, char *cwd_argv, uintptr_t *sp)
@@ -178,6 +179,10 @@ void arch_change_argv(int argc, char *cwd_argv, uintptr_t *sp)
 	uintptr_t *dest;
 	uintptr_t *src;
 	uintptr_t *len;
+	uintptr_t *aux;
+	size_t aux_len;
+	size_t envc;
+	char *env;
 
 	/* Skip CWD. */
 	for (p = cwd_argv; *p != '\0'; p++);
@@ -198,6 +203,39 @@ void arch_change_argv(int argc, char *cwd_argv, uintptr_t *sp)
 	/* Advance pointer until find a NUL, this is our source. */
 	for (src = dest; *src; src++);
 
+	/* Client environment (if any), ended by an empty string. */
+	for (envc = 0, env = p; *env; env += strlen(env) + 1)
+		envc++;
+
+	/* Find the auxv (after envp) and its length, AT_NULL included. */
+	for (aux = src + 1; *aux; aux++);
+	aux++;
+	for (aux_len = 0; aux[aux_len]; aux_len += 2);
+	aux_len += 2;
+
+	/*
+	 * Use the client environment: the envp is rebuilt right after
+	 * the new argv, followed by the auxv. Since musl, uClibc & co
+	 * get envp and auxv from the stack (and not from 'environ'),
+	 * this is the only way to make it work everywhere.
+	 *
+	 * If it does not fit in the space that the old argv + envp
+	 * had (quite unlikely, since the old argv has 200 elements),
+	 * the server environment is kept.
+	 */
+	if (envc && dest + 1 + envc + 1 <= aux)
+	{
+		memmove(dest + 1 + envc + 1, aux, aux_len * sizeof(uintptr_t));
+
+		dest[0] = 0;
+		for (count = 1, env = p; *env; env += strlen(env) + 1)
+			dest[count++] = (uintptr_t)env;
+		dest[count] = 0;
+
+		environ = (char **)&dest[1];
+		return;
+	}
+
 	/* Advance until find two NULs, this is our length. */
 	for (len = src + 1; *len; len++);
 	for (len = len + 1; *len; len++);
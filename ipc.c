@@ -22,6 +22,7 @@
  * SOFTWARE.
  */
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -135,7 +136,7 @@ int ipc_init(struct args *args)
 			sizeof(server.sun_path));
 	}
 
-	sv_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	sv_fd = socket(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0);
 	if (sv_fd < 0)
 		die("Cant start IPC!\n");
 
@@ -176,7 +177,7 @@ int ipc_wait_conn(void)
 {
 	int cli_fd;
 
-	cli_fd = accept(sv_fd, NULL, NULL);
+	cli_fd = accept4(sv_fd, NULL, NULL, SOCK_CLOEXEC);
 	if (cli_fd < 0)
 		die("Failed while accepting connections, aborting...\n");
 
@@ -188,8 +189,9 @@ int ipc_wait_conn(void)
 
 /**
  * @brief Receives the file descriptors (stdout, stdin and
- * stderr), the current work directory, and the command-line
- * arguments given to preloader_cli.
+ * stderr), the current work directory, the command-line
+ * arguments given to preloader_cli and, optionally, its
+ * environment (NUL-separated, ended by an empty string).
  *
  * @param conn_fd Client connection.
  * @param out Client stdout fd.
@@ -197,8 +199,8 @@ int ipc_wait_conn(void)
  * @param in  Client stdin fd.
  * @param argc_p Argument count pointer.
  *
- * @return Returns the current work directory and the
- * argument list.
+ * @return Returns the current work directory, the argument
+ * list and the environment.
  */
 char* ipc_recv_msg(
 	int conn_fd, int *out, int *err, int *in, int *argc_p)
@@ -229,7 +231,7 @@ char* ipc_recv_msg(
 		return (NULL);
 
 	/* Receive real & ancillary data. */
-	nr = recvmsg(conn_fd, &msghdr, 0);
+	nr = recvmsg(conn_fd, &msghdr, MSG_CMSG_CLOEXEC);
 
 	/*
 	 * We should receive at least 8 bytes:
@@ -265,7 +267,8 @@ char* ipc_recv_msg(
 	*in  = fds[2];
 
 	/* Read CWD and argv. */
-	cwd_argv = malloc(rem_bytes - 8);
+	/* +1: an extra NUL marks the end of the (optional) envp. */
+	cwd_argv = malloc(rem_bytes - 8 + 1);
 	if (!cwd_argv)
 		log_crit("Cant allocate memory (%d bytes)!\n", rem_bytes);
 
@@ -285,6 +288,7 @@ char* ipc_recv_msg(
 		rem_bytes -= nr;
 		p += nr;
 	}
+	*p = '\0';
 
 	return (cwd_argv);
 out0:
@@ -297,12 +301,16 @@ out0:
  * socket pointed by @p fd.
  *
  * @return Returns 1 if success, 0 otherwise.
+ *
+ * @note The client might already be gone (e.g: if it
+ * got the exit status from the child itself), so
+ * do not raise SIGPIPE.
  */
 int ipc_send_int32(int32_t value, int fd)
 {
 	uint8_t buff[4];
 	int32_to_msg(value, buff);
-	return (send(fd, buff, sizeof buff, 0) == sizeof buff);
+	return (send(fd, buff, sizeof buff, MSG_NOSIGNAL) == sizeof buff);
 }
 
 /**
@@ -28,6 +28,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/stat.h>
 
 #include "arch.h"
 #include "ipc.h"
@@ -35,7 +36,9 @@
 #include "log.h"
 #include "preloader.h"
 #include "reaper.h"
+#include "spawner.h"
 #include "util.h"
+#include "wset.h"
 
 
 #ifndef PID_PATH
@@ -54,6 +57,53 @@ struct args args = {
 	.load_file = NULL,
 };
 
+/* Connection of the child with preloader_cli. */
+static int child_conn_fd = -1;
+static dev_t child_conn_dev;
+static ino_t child_conn_ino;
+static pid_t child_pid;
+
+/**
+ * @brief Child exit hook: sends the exit status straight to
+ * preloader_cli, before the kernel tears down the (possibly
+ * huge) child address space.
+ *
+ * This is the last exit handler to run: it was registered
+ * before __libc_start_main() registers the library
+ * destructors. The reaper still sends the real wait() result
+ * afterwards, which is the only one the client sees if the
+ * process is killed by a signal or crashes.
+ *
+ * @param status Status given to exit().
+ * @param arg Unused.
+ */
+static void child_exit(int status, void *arg)
+{
+	struct stat st;
+
+	((void)arg);
+
+	/* Forks of the child also inherit this handler, ignore them. */
+	if (getpid() != child_pid)
+		return;
+
+	/*
+	 * The program may have closed our connection and reused
+	 * its fd number for something else: if so, leave the
+	 * status to the reaper.
+	 */
+	if (fstat(child_conn_fd, &st) < 0 || st.st_dev != child_conn_dev ||
+		st.st_ino != child_conn_ino)
+	{
+		return;
+	}
+
+	/* Make sure the output reaches the client first. */
+	fflush(NULL);
+	ipc_send_int32(status & 0xFF, child_conn_fd);
+	ipc_close(1, child_conn_fd);
+}
+
 /**
  * @brief Setup most of the things that should be done before
  * our child/real process execute.
@@ -69,6 +119,17 @@ struct args args = {
 static char* setup_child(int conn_fd, int stdout_fd, int stderr_fd,
 	int stdin_fd, char *cwd_argv)
 {
+#if defined(__GLIBC__) || defined(__UCLIBC__)
+	struct stat st;
+#endif
+
+	/*
+	 * Send our own PID: this way it is guaranteed to reach
+	 * the client before our exit status.
+	 */
+	child_pid = getpid();
+	ipc_send_int32((int32_t)child_pid, conn_fd);
+
 	setenv("LD_BIND_NOW", "", 1);
 
 	/* Close server listening socket on client. */
@@ -85,7 +146,22 @@ static char* setup_child(int conn_fd, int stdout_fd, int stderr_fd,
 	dup2(stdin_fd,  STDIN_FILENO);
 	dup2(stdout_fd, STDOUT_FILENO);
 	dup2(stderr_fd, STDERR_FILENO);
-	ipc_close(4, stdin_fd, stdout_fd, stderr_fd, conn_fd);
+	ipc_close(3, stdin_fd, stdout_fd, stderr_fd);
+
+	/* Keep conn_fd (O_CLOEXEC) to report our exit status early. */
+#if defined(__GLIBC__) || defined(__UCLIBC__)
+	if (fstat(conn_fd, &st) < 0)
+		ipc_close(1, conn_fd);
+	else
+	{
+		child_conn_fd  = conn_fd;
+		child_conn_dev = st.st_dev;
+		child_conn_ino = st.st_ino;
+		on_exit(child_exit, NULL);
+	}
+#else
+	ipc_close(1, conn_fd);
+#endif
 
 	/* Set the current directory. */
 	if (chdir(cwd_argv) < 0)
@@ -93,6 +169,9 @@ static char* setup_child(int conn_fd, int stdout_fd, int stderr_fd,
 
 	/* Restore default signal handler. */
 	signal(SIGTERM, SIG_DFL);
+
+	/* Pre-populate the learned working set, if any. */
+	wset_populate();
 	return (cwd_argv);
 }
 
@@ -103,6 +182,9 @@ static char* setup_child(int conn_fd, int stdout_fd, int stderr_fd,
  * its arguments, fork a new process (to be normally executed)
  * and the proceeds to handle a next connection.
  *
+ * In spawn mode, the requested program is launched via
+ * posix_spawn instead, and this routine never returns.
+ *
  * @param argc Argument count pointer, this is the new child
                argc.
  *
@@ -124,6 +206,10 @@ char* daemon_main(int *argc)
 	ipc_init(&args);
 	reaper_init();
 
+	/* All libraries are loaded at this point, learn from them. */
+	if (args.wset && !args.spawn)
+		wset_init();
+
 	while (1)
 	{
 		conn_fd  = ipc_wait_conn();
@@ -137,16 +223,34 @@ char* daemon_main(int *argc)
 			goto again;
 		}
 
+		/* Children inherit the learned working set, if ready. */
+		wset_update();
+
+		/* Spawn mode: no fork, just launch the program. */
+		if (args.spawn)
+		{
+			pid = spawn_process(stdout_fd, stderr_fd, stdin_fd,
+				*argc, cwd_argv);
+
+			if (pid < 0)
+			{
+				ipc_send_int32(0, conn_fd);
+				ipc_send_int32(SPAWN_FAILED_RET, conn_fd);
+				ipc_close(1, conn_fd);
+				goto again;
+			}
+			/* Send child PID before the reaper can send its status. */
+			ipc_send_int32((int32_t)pid, conn_fd);
+			reaper_add_child(pid, conn_fd);
+		}
+
 		/* If child. */
-		if ((pid = fork()) == 0)
+		else if ((pid = fork()) == 0)
 			return setup_child(conn_fd, stdout_fd, stderr_fd,
 				stdin_fd, cwd_argv);
 		else
 			reaper_add_child(pid, conn_fd);
 
-		/* Send child PID. */
-		ipc_send_int32((int32_t)pid, conn_fd);
-
 	again:
 		/* Keep conn_fd as our reaper will close the connection. */
 		ipc_close(3, stdin_fd, stdout_fd, stderr_fd);
@@ -206,6 +310,14 @@ static void parse_args(void)
 	/* Check if should load a given file too. */
 	if ((env = getenv("PRELOADER_LOAD_FILE")) != NULL)
 		args.load_file = strdup(env);
+
+	/* Check spawn mode. */
+	if (getenv("PRELOADER_SPAWN"))
+		args.spawn = 1;
+
+	/* Check working set learning. */
+	if (getenv("PRELOADER_WSET"))
+		args.wset = 1;
 }
 
 /**
@@ -247,6 +359,8 @@ static void daemonize(void)
  */
 void __attribute__ ((constructor)) my_init(void)
 {
+	int argc;
+
 	parse_args();
 
 	/* Check if we're already running, if so, do nothing. */
@@ -276,6 +390,17 @@ void __attribute__ ((constructor)) my_init(void)
 	/* Setup signals. */
 	signal(SIGTERM, sig_handler);
 
+	/*
+	 * Spawn mode: there is nothing to preload, so serve the
+	 * requests right away, from the smallest address space
+	 * possible. Also, spawned programs should not load us.
+	 */
+	if (args.spawn)
+	{
+		unsetenv("LD_PRELOAD");
+		daemon_main(&argc);
+	}
+
 	/* Read a load file, if specified. */
 	if (args.load_file)
 		load_file(args.load_file);
@@ -284,4 +409,14 @@ void __attribute__ ((constructor)) my_init(void)
 	arch_setup();
 }
 
-void __attribute__ ((destructor)) my_fini(void){}
+/**
+ * @brief Preloader library 'exitpoint'
+ *
+ * Since the daemon never exits normally, this is only
+ * reached by the children.
+ */
+void __attribute__ ((destructor)) my_fini(void)
+{
+	/* Forks of the child also run this, only sample the child. */
+	wset_learn(child_pid);
+}
@@ -37,6 +37,10 @@
 		int   log_fd;
 		/* Load file. */
 		char *load_file;
+		/* Spawn mode. */
+		int   spawn;
+		/* Working set learning. */
+		int   wset;
 	};
 
 #endif /* PRELOADER_H */
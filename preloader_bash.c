@@ -0,0 +1,402 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2022 Davidson Francis <davidsondfgl@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Bash loadable builtin for the preloader.
+ *
+ * Scripts that call a preloaded program in a loop still make bash
+ * fork itself and exec preloader_cli on each iteration, which may
+ * cost more than the preloaded program start itself.
+ *
+ * This builtin talks directly to the preloader daemon instead:
+ * it sends the shell's std* fds, cwd, arguments and exported
+ * environment, waits for the exit status and sets '$?' with it,
+ * without any intermediate process:
+ *
+ *   $ enable -f libpreloader_bash.so preload
+ *   $ preload [-p <port>] <program> <program-arguments>
+ *
+ * The wire protocol is the same as the one used by preloader_cli.
+ */
+
+#include <config.h>
+
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "loadables.h"
+
+#ifndef PID_PATH
+#define PID_PATH "/tmp"
+#endif
+
+#define SV_DEFAULT_PORT 3636
+
+/* Process PID, for signal forwarding. */
+static volatile pid_t process_pid;
+
+/**
+ * @brief Given a 32-bit message, encodes the content
+ * to be sent.
+ *
+ * @param msg Message to be encoded.
+ * @param msg_buff Target buffer.
+ */
+static inline void int32_to_msg(int32_t msg, uint8_t *msg_buff)
+{
+	/* Encodes as big-endian. */
+	msg_buff[0] = (msg >> 24);
+	msg_buff[1] = (msg >> 16);
+	msg_buff[2] = (msg >>  8);
+	msg_buff[3] = (msg >>  0);
+}
+
+/**
+ * @brief Given a 32-bit message, decodes the content
+ * as a int32_t number.
+ *
+ * @param msg Content to be decoded.
+ *
+ * @return Returns message as uint32_t.
+ */
+static inline int32_t msg_to_int32(uint8_t *msg)
+{
+	int32_t msg_int;
+	/* Decodes as big-endian. */
+	msg_int = (msg[3] << 0) | (msg[2] << 8) | (msg[1] << 16) |
+		(msg[0] << 24);
+	return (msg_int);
+}
+
+/**
+ * @brief Prepare the data that should be sent to the server
+ * and returns them as a char buffer.
+ *
+ * Layout: argc, amount of bytes, cwd, argv and envp, all
+ * strings NUL-terminated and envp ended by an empty string.
+ *
+ * @param size Amount of data to be sent.
+ * @param list Argument list.
+ * @param envp Environment list.
+ *
+ * @return If success, returns the data to be sent (as an char
+ * array), otherwise, NULL.
+ */
+static char* prepare_data(size_t *size, WORD_LIST *list, char **envp)
+{
+	WORD_LIST *l;
+	uint32_t amnt;
+	char *p, *buff;
+	char **env;
+	int argc;
+	char cwd[4096] = {0};
+
+	/* Get current working directory. */
+	if (!getcwd(cwd, sizeof(cwd)))
+		return (NULL);
+
+	/* Get the amount of data to be sent. */
+	amnt = (uint32_t)strlen(cwd) + 1;
+	for (l = list, argc = 0; l; l = l->next, argc++)
+		amnt += (uint32_t)strlen(l->word->word) + 1;
+	for (env = envp; env && *env; env++)
+		amnt += (uint32_t)strlen(*env) + 1;
+	amnt += 1; /* envp end. */
+	amnt += 8; /* argc + amt_bytes. */
+
+	/* Allocate and create buffer to be sent. */
+	buff = calloc(amnt + 1, sizeof(char));
+	if (!buff)
+		return (NULL);
+
+	int32_to_msg(argc, (uint8_t*)buff);
+	int32_to_msg(amnt, (uint8_t*)buff + 4);
+
+	p = buff + 8; /* skip argc + amnt. */
+
+	strcpy(p, cwd);
+	p += strlen(p) + 1;
+	for (l = list; l; l = l->next)
+	{
+		strcpy(p, l->word->word);
+		p += strlen(p) + 1;
+	}
+	for (env = envp; env && *env; env++)
+	{
+		strcpy(p, *env);
+		p += strlen(p) + 1;
+	}
+
+	*size = amnt;
+	return (buff);
+}
+
+/**
+ * @brief Connect to a given Unix Domain Socket ID and
+ * saves the socket into @p sock.
+ *
+ * @param port Socket ID to be connect.
+ * @param sock Returned socket pointer.
+ *
+ * @return Returns 0 if success, -1 otherwise.
+ */
+static int do_connect(uint16_t port, int *sock)
+{
+	struct sockaddr_un sock_addr;
+
+	*sock = socket(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0);
+	if (*sock < 0)
+		return (-1);
+
+	memset((void*)&sock_addr, 0, sizeof(sock_addr));
+	sock_addr.sun_family = AF_UNIX;
+	snprintf(sock_addr.sun_path, sizeof sock_addr.sun_path - 1,
+		"%s/preloader_%d.sock", PID_PATH, port);
+
+	if (connect(*sock, (struct sockaddr *)&sock_addr,
+		sizeof(sock_addr)) < 0)
+	{
+		close(*sock);
+		return (-1);
+	}
+	return (0);
+}
+
+/**
+ * @brief Send to @p sock all the data in the buffer @p buffer_data
+ * and also the shell's current std* file descriptors.
+ *
+ * @param sock Connection to send the data + fds.
+ * @param buff_data Data to be sent.
+ * @param buff_data_len Buffer length.
+ *
+ * @return Returns a positive number if success, otherwise, returns
+ * a number lesser than or equal 0.
+ */
+static ssize_t send_fds(int sock, char *buff_data, size_t buff_data_len)
+{
+	struct cmsghdr *cmsghdr;
+	struct msghdr msghdr;
+	struct iovec iov;
+	int fds[3] = {STDOUT_FILENO, STDERR_FILENO, STDIN_FILENO};
+
+	char buff[CMSG_SPACE(3 * sizeof(int))];
+
+	/* Fill message header and our I/O vec. */
+	memset(&msghdr, 0, sizeof(msghdr));
+	msghdr.msg_iov = &iov;
+	msghdr.msg_iovlen = 1;
+	iov.iov_base = buff_data;
+	iov.iov_len = buff_data_len;
+
+	/* Set 'msghdr' fields that describe ancillary data */
+	msghdr.msg_control = buff;
+	msghdr.msg_controllen = sizeof(buff);
+
+	/* Set up ancillary data describing file descriptor to send */
+	cmsghdr = CMSG_FIRSTHDR(&msghdr);
+	memset(cmsghdr, 0, sizeof(*cmsghdr));
+	cmsghdr->cmsg_level = SOL_SOCKET;
+	cmsghdr->cmsg_type = SCM_RIGHTS;
+	cmsghdr->cmsg_len = CMSG_LEN(sizeof(int) * 3);
+
+	/* Copy fds. */
+	memcpy(CMSG_DATA(cmsghdr), &fds, sizeof(int) * 3);
+
+	/* Send real data plus ancillary data */
+	return sendmsg(sock, &msghdr, MSG_NOSIGNAL);
+}
+
+/**
+ * @brief Receives a int32_t from @p sock, retrying if
+ * interrupted by a (forwarded) signal.
+ *
+ * @param sock Connection socket.
+ * @param value Received value.
+ *
+ * @return Returns 0 if success, -1 otherwise.
+ */
+static int recv_int32(int sock, int32_t *value)
+{
+	uint8_t buff[4];
+	ssize_t r;
+
+	do
+		r = recv(sock, buff, sizeof buff, MSG_WAITALL);
+	while (r < 0 && errno == EINTR);
+
+	if (r != sizeof buff)
+		return (-1);
+
+	*value = msg_to_int32(buff);
+	return (0);
+}
+
+/**
+ * @brief Builtin signal handler: just like preloader_cli,
+ * forwards the signals to the original process.
+ *
+ * @param sig Signal received.
+ */
+static void sig_handler(int sig)
+{
+	if (process_pid)
+		kill(process_pid, sig);
+}
+
+/**
+ * @brief 'preload' builtin entry point.
+ *
+ * @param list Builtin arguments.
+ *
+ * @return Returns the program exit status, or
+ * EXECUTION_FAILURE/EX_USAGE on errors.
+ */
+int preload_builtin(WORD_LIST *list)
+{
+	struct sigaction sa, old_int, old_term;
+	intmax_t port;
+	char *send_buff;
+	int32_t ret;
+	size_t amnt;
+	int sock;
+	int opt;
+
+	port = SV_DEFAULT_PORT;
+
+	reset_internal_getopt();
+	while ((opt = internal_getopt(list, "p:")) != -1)
+	{
+		switch (opt)
+		{
+			case 'p':
+				if (!legal_number(list_optarg, &port) || port < 0 ||
+					port > 65535)
+				{
+					builtin_error("invalid port number: %s", list_optarg);
+					return (EX_USAGE);
+				}
+				break;
+			CASE_HELPOPT;
+			default:
+				builtin_usage();
+				return (EX_USAGE);
+		}
+	}
+	list = loptend;
+
+	if (!list)
+	{
+		builtin_usage();
+		return (EX_USAGE);
+	}
+
+	/* Exported environment, just like a regular command. */
+	maybe_make_export_env();
+
+	if (!(send_buff = prepare_data(&amnt, list, export_env)))
+	{
+		builtin_error("unable to prepare data to be sent");
+		return (EXECUTION_FAILURE);
+	}
+
+	ret = EXECUTION_FAILURE;
+
+	if (do_connect((uint16_t)port, &sock) < 0)
+	{
+		builtin_error("unable to connect on sv port %d", (int)port);
+		goto out0;
+	}
+
+	/* Make sure the child sees everything written so far. */
+	fflush(stdout);
+	fflush(stderr);
+
+	if (send_fds(sock, send_buff, amnt) != (ssize_t)amnt)
+	{
+		builtin_error("unable to send the file descriptors");
+		goto out1;
+	}
+
+	/* Forward SIGINT/SIGTERM while the process runs. */
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = sig_handler;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGINT,  &sa, &old_int);
+	sigaction(SIGTERM, &sa, &old_term);
+
+	/* Process PID and then its return value. */
+	if (recv_int32(sock, &ret) == 0)
+	{
+		process_pid = ret;
+		if (recv_int32(sock, &ret) < 0)
+			ret = EXECUTION_FAILURE;
+	}
+	else
+		ret = EXECUTION_FAILURE;
+
+	process_pid = 0;
+	sigaction(SIGINT,  &old_int,  NULL);
+	sigaction(SIGTERM, &old_term, NULL);
+
+out1:
+	close(sock);
+out0:
+	free(send_buff);
+	return ((int)ret & 0xFF);
+}
+
+/* Builtin documentation. */
+char *preload_doc[] = {
+	"Run a program through the preloader daemon.",
+	"",
+	"Sends PROGRAM and its ARGUMENTS, along with the shell's standard",
+	"file descriptors, current directory and exported environment, to",
+	"the preloader daemon listening on PORT (default: 3636), without",
+	"forking the shell.",
+	"",
+	"Options:",
+	"  -p PORT\tconnect to the daemon listening on PORT",
+	"",
+	"Exit Status:",
+	"Returns the exit status of PROGRAM.",
+	(char *)NULL
+};
+
+/* Builtin definition. */
+struct builtin preload_struct = {
+	"preload",
+	preload_builtin,
+	BUILTIN_ENABLED,
+	preload_doc,
+	"preload [-p port] program [arguments ...]",
+	0
+};
@@ -53,6 +53,9 @@
 
 #define SV_DEFAULT_PORT 3636
 
+/* Environment variables pointer. */
+extern char **environ;
+
 /* Process PID. */
 static pid_t process_pid;
 
@@ -93,6 +96,9 @@ static inline int32_t msg_to_int32(uint8_t *msg)
  * @brief Prepare the initial data that should be sent to the
  * server and returns them as a char buffer.
  *
+ * Layout: argc, amount of bytes, cwd, argv and envp, all
+ * strings NUL-terminated and envp ended by an empty string.
+ *
  * @param size Amount of data to be sent.
  * @param argc Argument count.
  * @param argv Argument list.
@@ -105,6 +111,7 @@ static char* prepare_data(size_t *size, int argc, char **argv)
 	int i;
 	uint32_t amnt;
 	char *p, *buff;
+	char **env;
 	char cwd[4096] = {0};
 
 	/* Get current working directory. */
@@ -116,6 +123,9 @@ static char* prepare_data(size_t *size, int argc, char **argv)
 	for (i = 0; i < argc; i++)
 		amnt += (uint32_t)strlen(argv[i]);
 	amnt += argc + 1; /* + number of 'NUL'. */
+	for (env = environ; *env; env++)
+		amnt += (uint32_t)strlen(*env) + 1;
+	amnt += 1; /* envp end. */
 	amnt += 8; /* argc + amt_bytes. */
 
 	/* Allocate and create buffer to be sent. */
@@ -135,6 +145,11 @@ static char* prepare_data(size_t *size, int argc, char **argv)
 		strcpy(p, argv[i]);
 		p += strlen(p) + 1;
 	}
+	for (env = environ; *env; env++)
+	{
+		strcpy(p, *env);
+		p += strlen(p) + 1;
+	}
 
 	*size = amnt;
 	return (buff);
@@ -346,7 +361,7 @@ static ssize_t send_fds(int sock, char *buff_data, size_t buff_data_len)
 	memcpy(CMSG_DATA(cmsghdr), &fds, sizeof(int) * 3);
 
 	/* Send real data plus ancillary data */
-	return sendmsg(sock, &msghdr, 0);
+	return sendmsg(sock, &msghdr, MSG_NOSIGNAL);
 }
 
 /**
@@ -22,8 +22,10 @@
  * SOFTWARE.
  */
 
+#include <errno.h>
 #include <stdlib.h>
 #include <pthread.h>
+#include <time.h>
 #include <unistd.h>
 #include <sys/wait.h>
 
@@ -63,6 +65,9 @@
 /* Children list mutex. */
 static pthread_mutex_t list_mutex = PTHREAD_MUTEX_INITIALIZER;
 
+/* Signaled when a new child is added. */
+static pthread_cond_t list_cond = PTHREAD_COND_INITIALIZER;
+
 /* Children list. */
 static struct child_list
 {
@@ -77,24 +82,48 @@ static struct child_list
 
 /**
  * @brief Given a pid @p pid, gets the position
- * the child process occupies in the list.
+ * the child process occupies in the list, waiting
+ * up to @p timeout_ms for it to be added.
  *
  * @param pid Child pid.
+ * @param timeout_ms Max time to wait (in milliseconds).
  *
  * @return If success, returns a number greater
  * than or equal 0. Otherwise, returns -1.
  */
-static off_t get_child_pos(pid_t pid)
+static off_t get_child_pos(pid_t pid, int timeout_ms)
 {
+	struct timespec deadline;
+	int timedout;
 	off_t i;
 
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec  += timeout_ms / 1000;
+	deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+	if (deadline.tv_nsec >= 1000000000L)
+	{
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000L;
+	}
+
+	timedout = 0;
+
 pthread_mutex_lock(&list_mutex);
-	for (i = 0; i < (off_t)cl.size; i++)
-		if (cl.c[i].pid == pid)
+	while (1)
+	{
+		for (i = 0; i < (off_t)cl.size; i++)
+			if (cl.c[i].fd != -1 && cl.c[i].pid == pid)
+				goto out;
+
+		if (timedout)
 			break;
 
-	if (i == (off_t)cl.size)
-		i = -1;
+		/* Not there yet, wait for reaper_add_child(). */
+		timedout = pthread_cond_timedwait(&list_cond, &list_mutex,
+			&deadline) == ETIMEDOUT;
+	}
+	i = -1;
+out:
 pthread_mutex_unlock(&list_mutex);
 
 	return (i);
@@ -135,15 +164,16 @@ static void* wait_children(void *p)
 		/*
 		 * There may be a slight race condition where the child
 		 * process dies before the parent process even adds it
-		 * to the list. To work around this scenario, the code
-		 * below tries MAX_ATTEMPTS times to get the child of
-		 * the list, with a pause of PAUSE_MS milliseconds
-		 * between each attempt.
+		 * to the list (quite common in spawn mode). To work
+		 * around this scenario, the code below tries MAX_ATTEMPTS
+		 * times to get the child of the list, waiting up to
+		 * PAUSE_MS milliseconds for it to be added on each
+		 * attempt.
 		 *
 		 * If it still can't get it, the daemon is aborted.
 		 */
 	again:
-		cpos = get_child_pos(pid);
+		cpos = get_child_pos(pid, PAUSE_MS);
 		if (cpos < 0)
 		{
 			attempts++;
@@ -152,10 +182,7 @@ static void* wait_children(void *p)
 				pid, attempts, MAX_ATTEMPTS);
 
 			if (attempts < MAX_ATTEMPTS)
-			{
-				usleep(PAUSE_MS * 1000);
 				goto again;
-			}
 			else
 				die("Attempts exceeded for pid: %d, aborting!\n", pid);
 		}
@@ -170,8 +197,11 @@ static void* wait_children(void *p)
 		else
 			ret = 1;
 
-		/* Send return code. */
-		if (!ipc_send_int32(ret, cl.c[cpos].fd))
+		/*
+		 * Send return code. Normal exits were (most likely) already
+		 * reported by the child itself, so the client may be gone.
+		 */
+		if (!ipc_send_int32(ret, cl.c[cpos].fd) && !WIFEXITED(wstatus))
 			log_crit("Unable to send return value to (pid: %d / fd: %d), "
 				"maybe disconnected?\n", pid, cl.c[cpos].fd);
 
@@ -250,6 +280,7 @@ pthread_mutex_lock(&list_mutex);
 	cl.c[pos].pid = pid;
 	cl.c[pos].fd  = fd;
 	cl.last_empty = pos + 1; /* just an educated guess. */
+	pthread_cond_broadcast(&list_cond);
 pthread_mutex_unlock(&list_mutex);
 }
 
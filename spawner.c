@@ -0,0 +1,293 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2022 Davidson Francis <davidsondfgl@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "log.h"
+#include "spawner.h"
+
+/* Environment variables pointer. */
+extern char **environ;
+
+/*
+ * What is the spawn mode?
+ * Big processes (think of multi-GB Python or Java orchestrators)
+ * pay a high price just to launch small tools: even with COW,
+ * fork() needs to copy the whole page table of the parent before
+ * the child can exec anything.
+ *
+ * In spawn mode, instead of forking a preloaded program, the
+ * daemon acts as a tiny 'spawn helper': it receives argv, cwd
+ * and std fds exactly like in the preload mode, but launches
+ * the requested program via posix_spawn(). Since the daemon's
+ * address space is minimal and posix_spawn uses vfork semantics
+ * (CLONE_VM|CLONE_VFORK on glibc), the cost for the client is
+ * just a socket round trip.
+ *
+ * The reaper and the protocol remain the same: the client
+ * receives the child PID and, later, its return code.
+ */
+
+/**
+ * @brief Given a cwd_argv buffer as received from the client,
+ * build NULL-terminated argument and environment lists
+ * pointing to it.
+ *
+ * @param argc Argument count.
+ * @param cwd_argv Current work dir + argument list + envp.
+ * @param envp_p Returned environment list, or NULL if the
+ *               client has not sent one.
+ *
+ * @return Returns the argument list if success, NULL otherwise.
+ */
+static char **build_argv(int argc, char *cwd_argv, char ***envp_p)
+{
+	char **argv, **envp;
+	int i, envc;
+	char *p, *e;
+
+	if (argc <= 0)
+		return (NULL);
+
+	argv = calloc(argc + 1, sizeof(char *));
+	if (!argv)
+		return (NULL);
+
+	/* Skip CWD. */
+	p = cwd_argv + strlen(cwd_argv) + 1;
+
+	for (i = 0; i < argc; i++)
+	{
+		argv[i] = p;
+		p += strlen(p) + 1;
+	}
+
+	/* Environment, ended by an empty string. */
+	*envp_p = NULL;
+	for (e = p, envc = 0; *e; e += strlen(e) + 1)
+		envc++;
+
+	if (!envc)
+		return (argv);
+
+	envp = calloc(envc + 1, sizeof(char *));
+	if (!envp)
+	{
+		free(argv);
+		return (NULL);
+	}
+
+	for (i = 0; i < envc; i++)
+	{
+		envp[i] = p;
+		p += strlen(p) + 1;
+	}
+
+	*envp_p = envp;
+	return (argv);
+}
+
+/**
+ * @brief Finds the program @p file in the PATH of the
+ * environment @p envp, just like execvp() does with
+ * the current one.
+ *
+ * @param file Program name.
+ * @param envp Environment list, or NULL to use ours.
+ * @param path Returned full path, PATH_MAX bytes long.
+ *
+ * @return Returns 0 if found, or an errno value otherwise.
+ */
+static int find_program(const char *file, char **envp, char *path)
+{
+	const char *env_path;
+	const char *p, *e;
+	struct stat st;
+	size_t dlen;
+	int ret;
+
+	/* Names with a slash are not searched. */
+	if (strchr(file, '/'))
+	{
+		if (strlen(file) >= PATH_MAX)
+			return (ENAMETOOLONG);
+		strcpy(path, file);
+		return (0);
+	}
+
+	env_path = NULL;
+	if (!envp)
+		env_path = getenv("PATH");
+	else
+	{
+		for (; *envp; envp++)
+			if (!strncmp(*envp, "PATH=", 5))
+				env_path = *envp + 5;
+	}
+
+	if (!env_path)
+		env_path = "/bin:/usr/bin";
+
+	ret = ENOENT;
+
+	for (p = env_path; ; p = e + 1)
+	{
+		e = strchr(p, ':');
+		if (!e)
+			e = p + strlen(p);
+
+		dlen = e - p;
+		if (dlen + strlen(file) + 2 <= PATH_MAX)
+		{
+			/* An empty entry means the current directory. */
+			if (!dlen)
+				snprintf(path, PATH_MAX, "%s", file);
+			else
+				snprintf(path, PATH_MAX, "%.*s/%s", (int)dlen, p, file);
+
+			if (!stat(path, &st) && S_ISREG(st.st_mode))
+			{
+				if (!access(path, X_OK))
+					return (0);
+				ret = EACCES;
+			}
+		}
+
+		if (!*e)
+			break;
+	}
+	return (ret);
+}
+
+/**
+ * @brief Launches the program described in @p cwd_argv with
+ * the client's std* fds, on the client's current directory.
+ *
+ * @param stdout_fd Stdout socket fd.
+ * @param stderr_fd Stderr socket fd.
+ * @param stdin_fd Stdin socket fd.
+ * @param argc Argument count.
+ * @param cwd_argv Current work dir + argument list + envp.
+ *
+ * @return Returns the new child pid if success, -1 otherwise.
+ *
+ * @note On failure, an error message is written to the client
+ * stderr, just like a shell does when a command is not found.
+ */
+pid_t spawn_process(int stdout_fd, int stderr_fd,
+	int stdin_fd, int argc, char *cwd_argv)
+{
+	posix_spawn_file_actions_t fa;
+	posix_spawnattr_t attr;
+	char path[PATH_MAX];
+	char **argv;
+	char **envp;
+	int old_cwd;
+	pid_t pid;
+	int ret;
+
+	pid = -1;
+
+	if (!(argv = build_argv(argc, cwd_argv, &envp)))
+	{
+		log_err("Unable to build argument list (argc: %d)\n", argc);
+		return (-1);
+	}
+
+	/*
+	 * posix_spawn() has no portable way to change the child's
+	 * current directory, so we change our own and restore it
+	 * right after. This is safe here: the reaper thread does
+	 * not rely on the cwd.
+	 */
+	old_cwd = open(".", O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+	if (old_cwd < 0)
+		die("Unable to open the current directory, aborting...\n");
+
+	if (chdir(cwd_argv) < 0)
+	{
+		dprintf(stderr_fd, "preloader: %s: %s\n", cwd_argv, strerror(errno));
+		log_err("Unable to chdir to: %s\n", cwd_argv);
+		goto out0;
+	}
+
+	/*
+	 * The program is searched in the client PATH (and from
+	 * the client cwd), not ours.
+	 */
+	if ((ret = find_program(argv[0], envp, path)) != 0)
+	{
+		dprintf(stderr_fd, "preloader: %s: %s\n", argv[0], strerror(ret));
+		log_err("Unable to find (%s): %s\n", argv[0], strerror(ret));
+		goto out1;
+	}
+
+	posix_spawn_file_actions_init(&fa);
+	posix_spawnattr_init(&attr);
+
+#ifdef POSIX_SPAWN_USEVFORK
+	posix_spawnattr_setflags(&attr, POSIX_SPAWN_USEVFORK);
+#endif
+
+	/*
+	 * Redirect std* to the preloader_cli fds. All the other fds
+	 * the daemon holds (server socket, connections, received
+	 * fds and log file) are O_CLOEXEC, so there is nothing else
+	 * to close here.
+	 */
+	posix_spawn_file_actions_adddup2(&fa, stdin_fd,  STDIN_FILENO);
+	posix_spawn_file_actions_adddup2(&fa, stdout_fd, STDOUT_FILENO);
+	posix_spawn_file_actions_adddup2(&fa, stderr_fd, STDERR_FILENO);
+
+	/* Use the client environment, if any. */
+	ret = posix_spawn(&pid, path, &fa, &attr, argv,
+		envp ? envp : environ);
+	if (ret)
+	{
+		dprintf(stderr_fd, "preloader: %s: %s\n", argv[0], strerror(ret));
+		log_err("Unable to spawn (%s): %s\n", argv[0], strerror(ret));
+		pid = -1;
+	}
+
+	posix_spawnattr_destroy(&attr);
+	posix_spawn_file_actions_destroy(&fa);
+
+out1:
+	if (fchdir(old_cwd) < 0)
+		die("Unable to restore the current directory, aborting...\n");
+
+out0:
+	close(old_cwd);
+	free(envp);
+	free(argv);
+	return (pid);
+}
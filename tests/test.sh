@@ -140,6 +140,124 @@ test2() {
 	pass "$test_name"
 }
 
+test_wset() {
+	local test_name="$1"
+	local log="$CURDIR/.log_wset.txt"
+
+	announce "$1"
+	rm -f "$log"
+
+	# 1) Launch preloader in daemon mode, w/ logs
+	$PROG "$TEST" -d -w -l all -o "$log"
+	sleep 2s # Wait for daemon start
+
+	# 2) Enough runs to sample and build the working set
+	for i in $(seq 1 20)
+	do
+		echo "input" | $CLI "$TEST" a b c &> /dev/null
+		out_c="$?"
+
+		if [ "$out_c" -ne 42 ]; then
+			not_pass "$test_name" "Failed on run $i!"
+		fi
+	done
+
+	# 3) Check if something was learned
+	if ! grep -qE "wset: learned [1-9][0-9]* pages" "$log"; then
+		not_pass "$test_name" "Working set not learned!"
+	fi
+
+	rm -f "$log"
+	pass "$test_name"
+}
+
+test_signal() {
+	local test_name="$1"
+
+	announce "$1"
+
+	# 1) Launch preloader in daemon mode
+	$PROG "$TEST" -d
+	sleep 2s # Wait for daemon start
+
+	#
+	# 2) Kill the (blocked on stdin) child: since it does not
+	# exit normally, the return code comes from the reaper,
+	# just like bash: 128+SIGKILL.
+	#
+	sleep 3 | $CLI "$TEST" a b c &> /dev/null &
+	local cli_pid="$!"
+	sleep 1s
+	local daemon_pid
+	daemon_pid="$(cat "${TMPDIR:-/tmp}/preloader_3636.pid")"
+	pkill -KILL -n -P "$daemon_pid"
+	wait "$cli_pid"
+	out_c="$?"
+
+	if [ "$out_c" -ne 137 ]; then
+		not_pass "$test_name" \
+		"Return code differ from expected!, expected: 137, got: $out_c"
+	fi
+
+	pass "$test_name"
+}
+
+test_env() {
+	local test_name="$1"
+	local bin_dir="$CURDIR/.bin"
+	local lib_bash
+	local out
+
+	announce "$1"
+	lib_bash=$(readlink -f "$CURDIR/../libpreloader_bash.so")
+
+	mkdir -p "$bin_dir"
+	printf '#!/bin/sh\necho "hello from rvhello"\n' > "$bin_dir/rvhello"
+	chmod +x "$bin_dir/rvhello"
+
+	# 1) Spawn mode: client PATH and environment
+	$PROG -d -x
+	sleep 2s # Wait for daemon start
+
+	out=$(PATH="$bin_dir:$PATH" $CLI rvhello 2>&1)
+	if [ "$out" != "hello from rvhello" ]; then
+		rm -rf "$bin_dir"
+		not_pass "$test_name" "Program not found in client PATH, got: $out"
+	fi
+	rm -rf "$bin_dir"
+
+	out=$(FOO=bar $CLI sh -c 'echo $FOO' 2>&1)
+	if [ "$out" != "bar" ]; then
+		not_pass "$test_name" "Client env not used (spawn), got: $out"
+	fi
+
+	# Bash builtin, if built
+	if [ -f "$lib_bash" ]; then
+		out=$(FOO=baz bash -c \
+			"enable -f '$lib_bash' preload && preload sh -c 'echo \$FOO'" 2>&1)
+		if [ "$out" != "baz" ]; then
+			not_pass "$test_name" "Client env not used (builtin), got: $out"
+		fi
+	fi
+	$PROG -s
+
+	# 2) Preload mode: client environment
+	$PROG "$TEST" -d
+	sleep 2s # Wait for daemon start
+
+	out=$(echo "input" | PWD="/env/test" $CLI "$TEST" a 2>&1)
+	if ! grep -q "PWD: (/env/test)" <<< "$out"; then
+		not_pass "$test_name" "Client env not used (preload)"
+	fi
+
+	pass "$test_name"
+}
+
 test1 ""   "#1: normal run "
 test1 "-b" "#2: run w/ bind"
 test2 ""   "#3: range test (this may take a while)"
+test1 "-x" "#4: spawn mode "
+test2 "-w" "#5: range test w/ working set"
+test_wset  "#6: working set learning"
+test_signal "#7: killed by signal"
+test_env    "#8: client environment"
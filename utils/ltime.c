@@ -56,7 +56,7 @@
  * enough to run system wide (~5k ELF executables) in about 30 minutes.
  *
  * Usage:
- *  ./ltime <folder-or-file> <folder-or-file> ....
+ *  ./ltime [-r <num_runs>] [-m] [-f <freq_file>] <folder-or-file> ....
  * Like:
  *  ./ltime clang ffprobe
  *  ./ltime /usr/bin/clang
@@ -70,6 +70,29 @@
  * Second column: time without preloader (normal run)
  * Third column:  time with preloader
  *
+ * Memory footprint and ranking (-m):
+ * On memory-limited devices, the real question is not only how much
+ * time is saved, but how much time is saved per megabyte of resident
+ * daemon. With -m, ltime also measures, after the daemon startup:
+ *
+ * - The daemon (template) RSS, PSS and Private_Dirty memory, from
+ *   /proc/<pid>/smaps_rollup (or smaps, on older kernels).
+ * - The per-child extra memory, i.e: the Private_Dirty + page tables
+ *   of a real child, blocked at the entry point of the program (a
+ *   copy patched to block instead of exit, and served by a second
+ *   daemon).
+ *
+ * and, at the end, outputs a ranking by 'benefit-per-MB' score:
+ *
+ *   score = (time w/o - time w/ preloader) * freq / daemon PSS (MB)
+ *
+ * where 'freq' is 1, or the invocation count found in a frequency
+ * file (-f), with one '<count> <program>' per line, like the output
+ * of 'uniq -c'. Programs not in the file have zero frequency.
+ *
+ *  $ cut -d' ' -f1 ~/.bash_history | sort | uniq -c > freq.txt
+ *  $ ./ltime -f freq.txt /usr/bin
+ *
  * Real-world scenario: Find the top-5 ELF files with the longer
  * load times without preloader:
  *
@@ -183,6 +206,49 @@ static const unsigned char patch_arm[] = {
 	0x00,0x00,0x00,0xef
 };
 
+/*
+ * 'Blocking' patches: used to measure a real child, that
+ * stays at its entry point until killed.
+ */
+
+/* mov $34, %eax # NR_pause.
+ * syscall
+ * jmp .-9 */
+static const unsigned char block_amd64[] = {
+	0xb8,0x22,0x00,0x00,0x00,0x0f,0x05,0xeb,
+	0xf7
+};
+
+/* mov $29, %eax # NR_pause.
+ * int $0x80
+ * jmp .-9 */
+static const unsigned char block_i386[] = {
+	0xb8,0x1d,0x00,0x00,0x00,0xcd,0x80,0xeb,
+	0xf7
+};
+
+/* mov x0, #0
+ * mov x1, #0
+ * mov x2, #0
+ * mov x3, #0
+ * mov x8, #73 # NR_ppoll (there is no pause).
+ * svc 0
+ * b .-24 */
+static const unsigned char block_aarch64[] = {
+	0x00,0x00,0x80,0xd2,0x01,0x00,0x80,0xd2,
+	0x02,0x00,0x80,0xd2,0x03,0x00,0x80,0xd2,
+	0x28,0x09,0x80,0xd2,0x01,0x00,0x00,0xd4,
+	0xfa,0xff,0xff,0x17
+};
+
+/* mov r7, #29 # NR_pause.
+ * swi 0
+ * b .-8 */
+static const unsigned char block_arm[] = {
+	0x1d,0x70,0xa0,0xe3,0x00,0x00,0x00,0xef,
+	0xfc,0xff,0xff,0xea
+};
+
 /* Some data about the ELF file. */
 static Elf *elf;
 static int nruns;
@@ -190,6 +256,36 @@ static int fd_elf;
 static regex_t regex;
 static char target_file[PATH_MAX];
 
+/* Memory measurements (in kB). */
+struct mem
+{
+	long rss;
+	long pss;
+	long priv_dirty;
+	long child;
+};
+
+/* Results, for the ranking. */
+static int mem_mode;
+static struct result
+{
+	char *file;
+	double ms_normal;
+	double ms_pre;
+	long freq;
+	double score;
+	struct mem mem;
+} *results;
+static size_t nresults;
+
+/* Invocation frequencies. */
+static struct freq
+{
+	char *prog;
+	long count;
+} *freqs;
+static size_t nfreqs;
+
 /**
  * @brief Given a file, open the ELF file and initialize
  * its data structure.
@@ -320,10 +416,13 @@ out0:
  *
  * @param off File offset to apply patch.
  * @param machine Machine type.
+ * @param block_nr If not NULL, the entry point blocks
+ *                 instead of exit, and the syscall it
+ *                 blocks on is returned here.
  *
  * @return Returns 0 if success, -1 otherwise.
  */
-static int patch_file(off_t off, int machine)
+static int patch_file(off_t off, int machine, int *block_nr)
 {
 	const unsigned char *patch;
 	size_t sp;
@@ -331,20 +430,28 @@ static int patch_file(off_t off, int machine)
 	switch (machine)
 	{
 		case EM_X86_64:
-			patch = patch_amd64;
-			sp = sizeof(patch_amd64);
+			patch = block_nr ? block_amd64 : patch_amd64;
+			sp = block_nr ? sizeof(block_amd64) : sizeof(patch_amd64);
+			if (block_nr)
+				*block_nr = 34;
 			break;
 		case EM_386:
-			patch = patch_i386;
-			sp = sizeof(patch_i386);
+			patch = block_nr ? block_i386 : patch_i386;
+			sp = block_nr ? sizeof(block_i386) : sizeof(patch_i386);
+			if (block_nr)
+				*block_nr = 29;
 			break;
 		case EM_AARCH64:
-			patch = patch_aarch64;
-			sp = sizeof(patch_aarch64);
+			patch = block_nr ? block_aarch64 : patch_aarch64;
+			sp = block_nr ? sizeof(block_aarch64) : sizeof(patch_aarch64);
+			if (block_nr)
+				*block_nr = 73;
 			break;
 		case EM_ARM:
-			patch = patch_arm;
-			sp = sizeof(patch_arm);
+			patch = block_nr ? block_arm : patch_arm;
+			sp = block_nr ? sizeof(block_arm) : sizeof(patch_arm);
+			if (block_nr)
+				*block_nr = 29;
 			break;
 		default:
 			fprintf(stderr, "Error, architecture not identified!\n");
@@ -533,15 +640,40 @@ static int start_daemon(void)
 }
 
 /**
- * @brief Stops a running preloader daemon.
+ * @brief Get the default pid file path.
  *
- * @return Returns 0 if successfully stopped, -1 otherwise.
+ * @param pid_file Target buffer.
+ * @param size Buffer size.
+ *
+ * @return Returns 0 if success, -1 otherwise.
  */
-static int stop_daemon(void)
+static int get_pid_file(char *pid_file, size_t size)
+{
+	char *tmp;
+
+	if (!(tmp = getenv("TMPDIR")))
+		tmp = "/tmp";
+
+	if (strlen(tmp) + sizeof "/preloader_3636.pid" > size)
+		errto(out0, "pid_file exceeds path capacity!\n");
+
+	snprintf(pid_file, size - 1, "%s/preloader_3636.pid", tmp);
+	return (0);
+out0:
+	return (-1);
+}
+
+/**
+ * @brief Reads the pid of the running preloader daemon.
+ *
+ * @param pid Returned daemon pid.
+ *
+ * @return Returns 0 if success, -1 otherwise.
+ */
+static int read_daemon_pid(pid_t *pid)
 {
-	char *tmp, pid_file[PATH_MAX];
+	char pid_file[PATH_MAX];
 	char buff[16] = {0};
-	pid_t pid;
 	ssize_t r;
 	int ret;
 	int fd;
@@ -549,13 +681,8 @@ static int stop_daemon(void)
 
 	ret = -1;
 
-	if (!(tmp = getenv("TMPDIR")))
-		tmp = "/tmp";
-
-	if (strlen(tmp) + sizeof "/preloader_3636.pid" > sizeof pid_file)
-		errto(out0, "pid_file exceeds path capacity!\n");
-
-	snprintf(pid_file, sizeof pid_file - 1, "%s/preloader_3636.pid", tmp);
+	if (get_pid_file(pid_file, sizeof pid_file) < 0)
+		goto out0;
 
 	if ((fd = open(pid_file, O_RDONLY)) < 0)
 		errto(out0, "PID file (%s) not found!\n", pid_file);
@@ -563,29 +690,314 @@ static int stop_daemon(void)
 	if ((r = read(fd, buff, sizeof buff)) < 0)
 		errto(out1, "Unable to read complete file!\n");
 
-	for (pid = 0, i = 0; i < r; i++)
+	for (*pid = 0, i = 0; i < r; i++)
 	{
 		if (buff[i] < '0' || buff[i] > '9')
 			errto(out1, "Malformed pid file!\n");
 		else
 		{
-			pid *= 10;
-			pid += (buff[i] - '0');
+			*pid *= 10;
+			*pid += (buff[i] - '0');
 		}
 	}
 
+	ret = 0;
+out1:
+	close(fd);
+out0:
+	return (ret);
+}
+
+/**
+ * @brief Stops a running preloader daemon.
+ *
+ * @return Returns 0 if successfully stopped, -1 otherwise.
+ */
+static int stop_daemon(void)
+{
+	char pid_file[PATH_MAX];
+	pid_t pid;
+	int ret;
+
+	ret = -1;
+
+	if (read_daemon_pid(&pid) < 0)
+		goto out0;
+
 	/* Try to kill the process. */
 	if (kill(pid, SIGTERM) < 0)
-		errto(out1, "Unable to kill daemon, maybe its not running?\n");
+		errto(out0, "Unable to kill daemon, maybe its not running?\n");
 
 	ret = 0;
-out1:
-	close(fd);
-	unlink(pid_file);
 out0:
+	if (!get_pid_file(pid_file, sizeof pid_file))
+		unlink(pid_file);
 	return (ret);
 }
 
+/**
+ * @brief Reads a /proc file for the process @p pid and sums all
+ * the values (in kB) of the lines that start with @p key.
+ *
+ * @param pid Target process.
+ * @param file File inside /proc/<pid>/.
+ * @param key Line key, like 'Rss:'.
+ *
+ * @return Returns the sum found, or -1 if the file
+ * cannot be read.
+ */
+static long read_proc_kb(pid_t pid, const char *file, const char *key)
+{
+	char path[64], line[256];
+	size_t klen;
+	long total;
+	long val;
+	FILE *f;
+
+	snprintf(path, sizeof path, "/proc/%d/%s", (int)pid, file);
+	if (!(f = fopen(path, "r")))
+		return (-1);
+
+	klen  = strlen(key);
+	total = 0;
+
+	while (fgets(line, sizeof line, f))
+		if (!strncmp(line, key, klen) &&
+			sscanf(line + klen, "%ld", &val) == 1)
+		{
+			total += val;
+		}
+
+	fclose(f);
+	return (total);
+}
+
+/**
+ * @brief Reads the smaps 'rollup' (i.e: the sum over all the
+ * mappings) value of @p key for the process @p pid.
+ *
+ * @param pid Target process.
+ * @param key Line key, like 'Rss:'.
+ *
+ * @return Returns the value (in kB), or -1 if error.
+ */
+static long read_smaps_kb(pid_t pid, const char *key)
+{
+	long val;
+
+	/* smaps_rollup is only available on Linux >= 4.14. */
+	if ((val = read_proc_kb(pid, "smaps_rollup", key)) < 0)
+		val = read_proc_kb(pid, "smaps", key);
+
+	return (val);
+}
+
+/**
+ * @brief Measures the memory footprint of the running
+ * preloader daemon.
+ *
+ * @param m Returned measurements (in kB).
+ *
+ * @return Returns 0 if success, -1 otherwise.
+ */
+static int measure_daemon(struct mem *m)
+{
+	pid_t pid;
+
+	if (read_daemon_pid(&pid) < 0)
+		return (-1);
+
+	m->rss        = read_smaps_kb(pid, "Rss:");
+	m->pss        = read_smaps_kb(pid, "Pss:");
+	m->priv_dirty = read_smaps_kb(pid, "Private_Dirty:");
+	if (m->rss < 0 || m->pss < 0 || m->priv_dirty < 0)
+		errto(out0, "Unable to read smaps for pid: %d\n", (int)pid);
+
+	return (0);
+out0:
+	return (-1);
+}
+
+/**
+ * @brief Reads a frequency file: one '<count> <program>'
+ * per line, like the output of 'uniq -c'.
+ *
+ * @param file Frequency file path.
+ *
+ * @return Returns 0 if success, -1 otherwise.
+ */
+static int read_freq_file(const char *file)
+{
+	char line[PATH_MAX + 32];
+	char prog[PATH_MAX];
+	struct freq *f;
+	long count;
+	FILE *fp;
+
+	if (!(fp = fopen(file, "r")))
+		errto(out0, "Unable to open frequency file: %s\n", file);
+
+	while (fgets(line, sizeof line, fp))
+	{
+		if (sscanf(line, "%ld %4095s", &count, prog) != 2)
+			continue;
+
+		if (!(f = realloc(freqs, (nfreqs + 1) * sizeof(*freqs))))
+			errto(out1, "Unable to allocate memory!\n");
+
+		freqs = f;
+		freqs[nfreqs].prog  = strdup(prog);
+		freqs[nfreqs].count = count;
+		nfreqs++;
+	}
+
+	fclose(fp);
+	return (0);
+out1:
+	fclose(fp);
+out0:
+	return (-1);
+}
+
+/**
+ * @brief Get the invocation frequency of @p file, either
+ * by its full path or by its basename.
+ *
+ * @param file Program name or path.
+ *
+ * @return Returns the frequency found, 1 if there is no
+ * frequency file and 0 if the program is not listed.
+ */
+static long get_freq(const char *file)
+{
+	const char *b1, *b2;
+	long count;
+	size_t i;
+
+	if (!freqs)
+		return (1);
+
+	b1 = strrchr(file, '/');
+	b1 = b1 ? b1 + 1 : file;
+
+	for (count = 0, i = 0; i < nfreqs; i++)
+	{
+		b2 = strrchr(freqs[i].prog, '/');
+		b2 = b2 ? b2 + 1 : freqs[i].prog;
+
+		if (!strcmp(file, freqs[i].prog) || !strcmp(b1, b2))
+			count += freqs[i].count;
+	}
+	return (count);
+}
+
+/**
+ * @brief Saves a new result to be ranked later.
+ *
+ * @param file Original file name.
+ * @param ms_normal Time without preloader.
+ * @param ms_pre Time with preloader.
+ * @param m Memory measurements.
+ */
+static void add_result(const char *file, double ms_normal,
+	double ms_pre, struct mem *m)
+{
+	struct result *r;
+	double mb;
+
+	if (!(r = realloc(results, (nresults + 1) * sizeof(*results))))
+		errxit("Unable to allocate memory!\n");
+
+	results = r;
+	r = &results[nresults++];
+
+	r->file      = strdup(file);
+	r->ms_normal = ms_normal;
+	r->ms_pre    = ms_pre;
+	r->freq      = get_freq(file);
+	r->mem       = *m;
+
+	mb = (double)m->pss / 1024.0;
+	r->score = (mb > 0 && r->freq) ? (ms_normal - ms_pre) * r->freq / mb : 0;
+}
+
+/**
+ * @brief qsort() compare routine: sort by score, in
+ * descending order.
+ */
+static int cmp_result(const void *a, const void *b)
+{
+	const struct result *r1 = a;
+	const struct result *r2 = b;
+
+	if (r1->score < r2->score)
+		return (1);
+	if (r1->score > r2->score)
+		return (-1);
+	return (0);
+}
+
+/**
+ * @brief Outputs the ranking of all the analyzed files
+ * by benefit-per-MB score and releases the results.
+ */
+static void print_ranking(void)
+{
+	size_t i;
+
+	if (!nresults)
+		return;
+
+	qsort(results, nresults, sizeof(*results), cmp_result);
+
+#if VERBOSE == 1
+	printf("\nRanking (ms saved * freq / MB of daemon PSS):\n");
+#endif
+
+	for (i = 0; i < nresults; i++)
+	{
+#if VERBOSE == 1
+		printf("%3zu) \"%s\", score: %f, saved: %f ms, freq: %ld, "
+			"PSS: %ld kB, RSS: %ld kB, Private_Dirty: %ld kB, "
+			"per child: %ld kB\n",
+			i + 1, results[i].file, results[i].score,
+			results[i].ms_normal - results[i].ms_pre, results[i].freq,
+			results[i].mem.pss, results[i].mem.rss,
+			results[i].mem.priv_dirty, results[i].mem.child);
+#else
+		printf("\"%s\", %f, %f ms, %ld, %ld kB, %ld kB, %ld kB, %ld kB\n",
+			results[i].file, results[i].score,
+			results[i].ms_normal - results[i].ms_pre, results[i].freq,
+			results[i].mem.pss, results[i].mem.rss,
+			results[i].mem.priv_dirty, results[i].mem.child);
+#endif
+		free(results[i].file);
+	}
+
+	free(results);
+	results  = NULL;
+	nresults = 0;
+}
+
+/**
+ * @brief Get the preloader_cli path.
+ *
+ * @return Returns the preloader_cli path if found,
+ * NULL otherwise.
+ */
+static const char *get_cli_path(void)
+{
+	struct stat st;
+
+	if (stat("../preloader_cli", &st) == 0)
+		return ("../preloader_cli");
+	if (stat("./preloader_cli", &st) == 0)
+		return ("./preloader_cli");
+	if (stat("/usr/local/bin/preloader_cli", &st) == 0)
+		return ("/usr/local/bin/preloader_cli");
+	return (NULL);
+}
+
 /**
  * @brief Starts a new process a measure its execution time.
  *
@@ -597,8 +1009,7 @@ out0:
 static double spawn_child_ms(int preload)
 {
 	struct timespec ts1, ts2;
-	char *proc, *arg1;
-	struct stat st;
+	const char *proc, *arg1;
 	int wstatus;
 	pid_t pid;
 	double ms;
@@ -608,17 +1019,8 @@ static double spawn_child_ms(int preload)
 	if (preload)
 	{
 		arg1 = target_file;
-		proc = "../preloader_cli";
-		if (stat(proc, &st) < 0)
-		{
-			proc = "./preloader_cli";
-			if (stat(proc, &st) < 0)
-			{
-				proc = "/usr/local/bin/preloader_cli";
-				if (stat(proc, &st) < 0)
-					return (-1);
-			}
-		}
+		if (!(proc = get_cli_path()))
+			return (-1);
 	}
 
 	clock_gettime(CLOCK_MONOTONIC, &ts1);
@@ -646,6 +1048,166 @@ static double spawn_child_ms(int preload)
 	return (ms);
 }
 
+/**
+ * @brief Waits for the newest child of the daemon @p daemon
+ * to block on the syscall @p nr.
+ *
+ * @param daemon Daemon pid.
+ * @param nr Syscall number.
+ *
+ * @return Returns the child pid if success, -1 otherwise.
+ */
+static pid_t wait_blocked_child(pid_t daemon, int nr)
+{
+	char path[64];
+	int child, tmp;
+	int cur_nr;
+	FILE *f;
+	int i, n;
+
+	/* Give up after 2 seconds. */
+	for (i = 0; i < 200; i++, usleep(10*1000))
+	{
+		snprintf(path, sizeof path, "/proc/%d/task/%d/children",
+			(int)daemon, (int)daemon);
+
+		if (!(f = fopen(path, "r")))
+			return (-1);
+
+		/*
+		 * The first one is the daemon's dummy (idle) child,
+		 * which also blocks on pause(): skip it.
+		 */
+		for (n = 0, child = -1; fscanf(f, "%d", &tmp) == 1; n++)
+			child = tmp;
+		fclose(f);
+
+		if (n < 2)
+			continue;
+
+		snprintf(path, sizeof path, "/proc/%d/syscall", child);
+		if (!(f = fopen(path, "r")))
+			continue;
+
+		tmp = fscanf(f, "%d", &cur_nr);
+		fclose(f);
+
+		if (tmp == 1 && cur_nr == nr)
+			return (child);
+	}
+	return (-1);
+}
+
+/**
+ * @brief Measures the extra memory of a real child: a new
+ * copy of @p tfile is patched to block (instead of exit) at
+ * the entry point, and a single request is made to a new
+ * daemon. When the child reaches the entry point, its
+ * Private_Dirty + page tables are the cost of a preloaded
+ * process, before running any code of its own.
+ *
+ * @param tfile Processed file (considering PATH).
+ * @param m Returned measurements (in kB).
+ *
+ * @return Returns 0 if success, -1 otherwise.
+ */
+static int measure_child(const char *tfile, struct mem *m)
+{
+	const char *cli;
+	pid_t daemon;
+	pid_t child;
+	pid_t pid;
+	int machine;
+	int is_dyn;
+	off_t foff;
+	int ret;
+	int nr;
+	int fd;
+
+	ret = -1;
+
+	if (!(cli = get_cli_path()))
+		goto out0;
+
+	if (copy_to_tmp(tfile) < 0)
+		goto out0;
+
+	if ((foff = get_entry_offset(target_file, &machine, &is_dyn)) < 0)
+		goto out1;
+
+	if (patch_file(foff, machine, &nr) < 0)
+		goto out1;
+	close_elf();
+
+	if (start_daemon() < 0)
+		goto out1;
+	usleep(250*1000); /* Wait for daemon start. */
+
+	if (read_daemon_pid(&daemon) < 0)
+		goto out2;
+
+	if ((pid = fork()) == 0)
+	{
+		if ((fd = open("/dev/null", O_RDWR)) >= 0)
+		{
+			dup2(fd, STDIN_FILENO);
+			dup2(fd, STDOUT_FILENO);
+			dup2(fd, STDERR_FILENO);
+		}
+		execlp(cli, cli, target_file, NULL);
+		exit(1);
+	}
+
+	if ((child = wait_blocked_child(daemon, nr)) > 0)
+	{
+		m->child  = read_smaps_kb(child, "Private_Dirty:");
+		m->child += read_proc_kb(child, "status", "VmPTE:");
+		kill(child, SIGKILL);
+		ret = 0;
+	}
+	else
+		kill(pid, SIGKILL); /* Child is killed with the daemon. */
+
+	waitpid(pid, NULL, 0);
+out2:
+	stop_daemon();
+out1:
+	unlink(target_file);
+	close_elf();
+out0:
+	return (ret);
+}
+
+/**
+ * @brief Outputs the results of a file and, if measuring
+ * memory, saves them to the ranking.
+ *
+ * @param orig_file Original parameter as-is.
+ * @param ms_normal Time without preloader.
+ * @param ms_pre Time with preloader.
+ * @param m Memory measurements, or NULL.
+ */
+static void report_file(const char *orig_file, double ms_normal,
+	double ms_pre, struct mem *m)
+{
+	if (m)
+		add_result(orig_file, ms_normal, ms_pre, m);
+
+#if VERBOSE == 1
+	printf("file: \"%s\", w/o: %f ms, w/ preloader: %f ms",
+		orig_file, ms_normal, ms_pre);
+	if (m)
+		printf(", PSS: %ld kB, RSS: %ld kB, Private_Dirty: %ld kB, "
+			"per child: %ld kB", m->pss, m->rss, m->priv_dirty, m->child);
+#else
+	printf("\"%s\", %f ms, %f ms", orig_file, ms_normal, ms_pre);
+	if (m)
+		printf(", %ld kB, %ld kB, %ld kB, %ld kB", m->pss, m->rss,
+			m->priv_dirty, m->child);
+#endif
+	printf("\n");
+}
+
 /**
  * @brief Benchmark a given file @p tfile both normally
  * and with preloader.
@@ -660,6 +1222,7 @@ static double spawn_child_ms(int preload)
 static int handle_file(const char *orig_file, const char *tfile)
 {
 	double ms_normal, ms_pre, ms_tmp;
+	struct mem m;
 	int machine;
 	off_t foff;
 	int is_dyn;
@@ -667,6 +1230,7 @@ static int handle_file(const char *orig_file, const char *tfile)
 	int i;
 
 	ret = -1;
+	ms_normal = ms_pre = 0;
 
 	/* Check if ELF. */
 	if (is_elf(tfile) < 0)
@@ -681,7 +1245,7 @@ static int handle_file(const char *orig_file, const char *tfile)
 		errto(out1, "Unable to get file offset or binary is static!\n");
 
 	/* Patch file for the appropriate architecture. */
-	if (patch_file(foff, machine) < 0)
+	if (patch_file(foff, machine, NULL) < 0)
 		errto(out1, "Unable to patch file!\n");
 	close_elf();
 
@@ -713,12 +1277,9 @@ static int handle_file(const char *orig_file, const char *tfile)
 	}
 	ms_pre /= nruns;
 
-#if VERBOSE == 1
-	printf("file: \"%s\", w/o: %f ms, w/ preloader: %f ms\n",
-		orig_file, ms_normal, ms_pre);
-#else
-	printf("\"%s\", %f ms, %f ms\n", orig_file, ms_normal, ms_pre);
-#endif
+	/* -- Memory footprint -- */
+	if (mem_mode && measure_daemon(&m) < 0)
+		errto(out2, "Unable to measure daemon memory!\n");
 
 	ret = 0;
 out2:
@@ -726,6 +1287,18 @@ out2:
 out1:
 	unlink(target_file);
 	close_elf();
+
+	if (ret < 0)
+		goto out0;
+
+	/* -- Per-child memory: needs its own daemon -- */
+	if (mem_mode && measure_child(tfile, &m) < 0)
+	{
+		fprintf(stderr, "Unable to measure a child of: %s\n", tfile);
+		m.child = -1;
+	}
+
+	report_file(orig_file, ms_normal, ms_pre, mem_mode ? &m : NULL);
 out0:
 	return (ret);
 }
@@ -767,9 +1340,15 @@ static int do_check(const char *path, const struct stat *info,
 static void usage(const char *prg)
 {
 	fprintf(stderr,
-		"Usage: %s [-r <num_runs>] [<program-name-or-path>...]\n"
+		"Usage: %s [-r <num_runs>] [-m] [-f <freq_file>] "
+		"[<program-name-or-path>...]\n"
 		"Options: \n"
-		"  -r <num_runs> How many times to run to get the average\n",
+		"  -r <num_runs>  How many times to run to get the average\n"
+		"  -m             Measure the daemon memory and output a\n"
+		"                 ranking by ms saved per MB\n"
+		"  -f <freq_file> Weight the ranking by the invocation counts\n"
+		"                 in <freq_file> ('<count> <program>' per\n"
+		"                 line), implies -m\n",
 		prg);
 	exit(EXIT_FAILURE);
 }
@@ -815,33 +1394,40 @@ static int str2int(int *out, const char *s)
  */
 static int handle_args(int argc, char **argv)
 {
-	int idx_files;
+	int c;
 
-	idx_files = 1;
 	nruns = 1;
 
-	/* Valid num args. */
-	if (argc < 2)
-		errto(err0, "At least <program-name-or-path> is required!\n");
-
-	/* Get number of runs. */
-	if (!strcmp(argv[1], "-r"))
+	while ((c = getopt(argc, argv, "r:mf:")) != -1)
 	{
-		if (argc < 4)
-			usage(argv[0]);
-
-		if (str2int(&nruns, argv[2]) < 0)
-			errto(err0, "Parameter '%s' is not a valid number!\n",
-				argv[2]);
-
-		if (!nruns)
-			errto(err0, "Parameter '%s' must be greater than 0!\n",
-				argv[2]);
-
-		idx_files = 3;
+		switch (c)
+		{
+			case 'r':
+				if (str2int(&nruns, optarg) < 0)
+					errto(err0, "Parameter '%s' is not a valid number!\n",
+						optarg);
+
+				if (nruns <= 0)
+					errto(err0, "Parameter '%s' must be greater than 0!\n",
+						optarg);
+				break;
+			case 'f':
+				if (read_freq_file(optarg) < 0)
+					errto(err0, "Unable to read frequency file!\n");
+				/* Fall through. */
+			case 'm':
+				mem_mode = 1;
+				break;
+			default:
+				usage(argv[0]);
+		}
 	}
 
-	return (idx_files);
+	/* Valid num args. */
+	if (optind >= argc)
+		errto(err0, "At least <program-name-or-path> is required!\n");
+
+	return (optind);
 err0:
 	usage(argv[0]);
 	return (0);
@@ -884,6 +1470,7 @@ int main(int argc, char **argv)
 			errto(out0, "Parametr (%s) is not a regular file!\n", file_path);
 	}
 out0:
+	print_ranking();
 	regfree(&regex);
 	return (0);
 }
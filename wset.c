@@ -0,0 +1,418 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2022 Davidson Francis <davidsondfgl@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "log.h"
+#include "wset.h"
+
+/*
+ * What is the working set learning?
+ * When the daemon forks, Linux does not copy the page-table
+ * entries of file-backed mappings that have no anonymous pages
+ * (like the .text of the program and its libraries). Therefore,
+ * every child re-faults the very same hot text pages, one minor
+ * fault at a time.
+ *
+ * To avoid this, the first WSET_SAMPLES children, right before
+ * exiting, read their /proc/self/pagemap and increment a (shared)
+ * counter for each page present on these mappings: since the PTEs
+ * were not inherited, a present page is a page the child touched.
+ *
+ * After that, the daemon builds a list of ranges with the pages
+ * touched by at least half of the samples, and each new child
+ * populates them in a few madvise(MADV_POPULATE_READ) calls,
+ * instead of thousands of page faults.
+ */
+
+#ifndef MADV_POPULATE_READ
+#define MADV_POPULATE_READ 22
+#endif
+
+/* Amount of children to learn from. */
+#define WSET_SAMPLES 8
+
+/* Max amount of mappings considered. */
+#define WSET_MAX_REGIONS 1024
+
+/*
+ * Max amount of forks to wait for the samples: children that
+ * are always killed (or never exit) never sample themselves.
+ */
+#define WSET_MAX_FORKS (WSET_SAMPLES * 32)
+
+/* Max gap (in pages) between two ranges to merge them. */
+#define WSET_MAX_GAP 4
+
+/* Pagemap entries read at once. */
+#define PAGEMAP_CHUNK 512
+#define PAGEMAP_PRESENT (1ULL << 63)
+
+/* File-backed, read-only mappings of the daemon. */
+static struct region
+{
+	uintptr_t start;
+	size_t    pages;
+	size_t    off;   /* Offset into the counters. */
+} regions[WSET_MAX_REGIONS];
+static int    nregions;
+static size_t total_pages;
+static long   page_size;
+
+/* Shared (between daemon and children) learning state. */
+static struct wset_shared
+{
+	int     samples;
+	pid_t   busy;    /* Pid of the sampling child, if any. */
+	uint8_t counters[];
+} *ws;
+
+/* Learned ranges to be populated, built by the daemon. */
+static struct range
+{
+	uintptr_t start;
+	size_t    len;
+} *ranges;
+static size_t nranges;
+static int    learned;
+static int    forks;
+
+/**
+ * @brief Reads /proc/self/maps and saves all file-backed,
+ * readable and non-writable mappings (code and read-only
+ * data) as candidate regions.
+ *
+ * @return Returns 0 if success, -1 otherwise.
+ */
+static int read_regions(void)
+{
+	unsigned long start, end, inode;
+	char perms[8];
+	ssize_t lbytes;
+	size_t  rbytes;
+	char   *line;
+	FILE   *f;
+
+	f = fopen("/proc/self/maps", "r");
+	if (!f)
+		return (-1);
+
+	line   = NULL;
+	rbytes = 0;
+	while ((lbytes = getline(&line, &rbytes, f)) != -1)
+	{
+		if (sscanf(line, "%lx-%lx %7s %*s %*s %lu", &start, &end,
+			perms, &inode) != 4)
+		{
+			continue;
+		}
+
+		/* Only file-backed, r-- or r-x, private mappings. */
+		if (!inode || perms[0] != 'r' || perms[1] != '-' ||
+			perms[3] != 'p')
+		{
+			continue;
+		}
+
+		if (nregions == WSET_MAX_REGIONS)
+		{
+			log_info("wset: max regions reached (%d), ignoring the rest\n",
+				WSET_MAX_REGIONS);
+			break;
+		}
+
+		regions[nregions].start = start;
+		regions[nregions].pages = (end - start) / page_size;
+		regions[nregions].off   = total_pages;
+		total_pages += regions[nregions].pages;
+		nregions++;
+	}
+
+	free(line);
+	fclose(f);
+	return (0);
+}
+
+/**
+ * @brief Initialize the working set learning: find the
+ * candidate regions and allocate the shared counters.
+ *
+ * @return Returns 0 if success, -1 otherwise.
+ *
+ * @note This should be called by the daemon after all
+ * libraries were loaded.
+ */
+int wset_init(void)
+{
+	page_size = sysconf(_SC_PAGESIZE);
+
+	if (read_regions() < 0 || !total_pages)
+	{
+		log_err("wset: unable to find regions to learn from!\n");
+		return (-1);
+	}
+
+	ws = mmap(NULL, sizeof(*ws) + total_pages, PROT_READ|PROT_WRITE,
+		MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+	if (ws == MAP_FAILED)
+	{
+		ws = NULL;
+		log_err("wset: unable to allocate counters (%zu pages)\n",
+			total_pages);
+		return (-1);
+	}
+
+	log_info("wset: learning from %d regions, %zu pages\n", nregions,
+		total_pages);
+	return (0);
+}
+
+/**
+ * @brief Acquires the sampling 'lock', taking it over if
+ * its owner died while sampling (e.g: it was killed).
+ *
+ * @param me Pid of the current process.
+ *
+ * @return Returns 1 if acquired, 0 otherwise.
+ */
+static int acquire_busy(pid_t me)
+{
+	pid_t owner;
+
+	if (__sync_bool_compare_and_swap(&ws->busy, 0, me))
+		return (1);
+
+	owner = __atomic_load_n(&ws->busy, __ATOMIC_ACQUIRE);
+	if (!owner || kill(owner, 0) == 0 || errno != ESRCH)
+		return (0);
+
+	/* Children have no log, so just take over silently. */
+	return (__sync_bool_compare_and_swap(&ws->busy, owner, me));
+}
+
+/**
+ * @brief Samples the pages touched by the current (child)
+ * process, if still learning.
+ *
+ * @param pid Pid of the preloaded child: other processes
+ *            that inherited the counters, like the forks
+ *            of the child, are not sampled.
+ *
+ * @note This is meant to be called by the children, at
+ * exit. If another child is already sampling, this one
+ * is just skipped.
+ */
+void wset_learn(pid_t pid)
+{
+	uint64_t pm[PAGEMAP_CHUNK];
+	size_t i, j, k, n;
+	uint8_t *c;
+	ssize_t r;
+	off_t off;
+	int fd;
+
+	if (!ws || getpid() != pid)
+		return;
+
+	if (__atomic_load_n(&ws->samples, __ATOMIC_ACQUIRE) >= WSET_SAMPLES)
+		return;
+
+	if (!acquire_busy(pid))
+		return;
+
+	fd = open("/proc/self/pagemap", O_RDONLY);
+	if (fd < 0)
+		goto out0;
+
+	for (i = 0; i < (size_t)nregions; i++)
+	{
+		off = (off_t)(regions[i].start / page_size) * sizeof(uint64_t);
+
+		for (j = 0; j < regions[i].pages; j += n)
+		{
+			n = regions[i].pages - j;
+			if (n > PAGEMAP_CHUNK)
+				n = PAGEMAP_CHUNK;
+
+			r = pread(fd, pm, n * sizeof(uint64_t),
+				off + (off_t)(j * sizeof(uint64_t)));
+			if (r <= 0)
+				break;
+
+			n = r / sizeof(uint64_t);
+			for (k = 0; k < n; k++)
+			{
+				c = &ws->counters[regions[i].off + j + k];
+				if ((pm[k] & PAGEMAP_PRESENT) && *c < UINT8_MAX)
+					(*c)++;
+			}
+		}
+	}
+
+	close(fd);
+	__atomic_add_fetch(&ws->samples, 1, __ATOMIC_RELEASE);
+out0:
+	__atomic_store_n(&ws->busy, 0, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Adds the page range [@p start, @p start + @p len) into
+ * the learned ranges list, merging with the previous one if
+ * close enough.
+ *
+ * @param start Range start address.
+ * @param len Range length (in bytes).
+ * @param merge If the range can be merged with the previous
+ *              one, i.e: if both belong to the same region.
+ *
+ * @return Returns 0 if success, -1 otherwise.
+ */
+static int add_range(uintptr_t start, size_t len, int merge)
+{
+	struct range *r;
+	size_t cap;
+
+	if (nranges && merge)
+	{
+		r = &ranges[nranges - 1];
+		if (start >= r->start + r->len &&
+			start - (r->start + r->len) <= WSET_MAX_GAP * (size_t)page_size)
+		{
+			r->len = start + len - r->start;
+			return (0);
+		}
+	}
+
+	/* Grow list in powers of two. */
+	if (!(nranges & (nranges - 1)))
+	{
+		cap = nranges ? nranges * 2 : 16;
+		r = realloc(ranges, cap * sizeof(*ranges));
+		if (!r)
+			return (-1);
+		ranges = r;
+	}
+
+	ranges[nranges].start = start;
+	ranges[nranges].len   = len;
+	nranges++;
+	return (0);
+}
+
+/**
+ * @brief Once enough samples are collected, builds the
+ * ranges list (in the daemon) to be inherited and
+ * populated by each new child.
+ *
+ * If the samples do not come after WSET_MAX_FORKS forks,
+ * the ranges are built with the samples available, if any.
+ *
+ * @note This is cheap to call before each fork: after
+ * the list is built, it is a no-op.
+ */
+void wset_update(void)
+{
+	uintptr_t start;
+	size_t i, j, pages;
+	int samples;
+	int merge;
+
+	if (!ws || learned)
+		return;
+
+	samples = __atomic_load_n(&ws->samples, __ATOMIC_ACQUIRE);
+	if (samples < WSET_SAMPLES)
+	{
+		if (++forks < WSET_MAX_FORKS)
+			return;
+
+		log_info("wset: only %d of %d samples after %d forks\n",
+			samples, WSET_SAMPLES, forks);
+	}
+
+	learned = 1;
+	pages   = 0;
+
+	if (!samples)
+	{
+		log_info("wset: nothing to learn from, giving up\n");
+		goto out;
+	}
+
+	for (i = 0; i < (size_t)nregions; i++)
+	{
+		merge = 0;
+		for (j = 0; j < regions[i].pages; j++)
+		{
+			/* Only pages 'typically' touched. */
+			if (ws->counters[regions[i].off + j] * 2 < samples)
+				continue;
+
+			start = regions[i].start + j * page_size;
+			if (add_range(start, page_size, merge) < 0)
+			{
+				log_err("wset: unable to allocate ranges list!\n");
+				nranges = 0;
+				goto out;
+			}
+			merge = 1;
+			pages++;
+		}
+	}
+
+	log_info("wset: learned %zu pages in %zu ranges\n", pages, nranges);
+
+out:
+	/* Counters are no longer needed. */
+	munmap(ws, sizeof(*ws) + total_pages);
+	ws = NULL;
+}
+
+/**
+ * @brief Pre-populates the learned ranges in the current
+ * (child) process.
+ */
+void wset_populate(void)
+{
+	size_t i;
+
+	for (i = 0; i < nranges; i++)
+	{
+		/* Kernel < 5.14 does not support it, just give up. */
+		if (madvise((void*)ranges[i].start, ranges[i].len,
+			MADV_POPULATE_READ) < 0 && errno == EINVAL)
+		{
+			break;
+		}
+	}
+}